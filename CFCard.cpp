@@ -15,14 +15,61 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
 
 #include "CFCard.h"
+#include <util/crc16.h>
 
 #define MODE_NOTINIT 0
 #define MODE_LBA 1
 #define MODE_CHS 2
 
+#define CACHE_MAGIC 0xcfca
+
 uint8_t disk_mode;
-uint8_t mode = MODE_NOTINIT;
+uint8_t mode[2] = {MODE_NOTINIT, MODE_NOTINIT}; //Master, slave
+uint8_t device = MASTER; //Selected device
+
+//Confirmed configuration, survives a reset of the Arduino but not a power cycle
+struct
+{
+    uint16_t magic;
+    uint8_t mode[2];
+} init_cache __attribute__((section(".noinit")));
+
+/* Reset cause, saved before main() because MCUSR is cleared here. Its flags would
+otherwise add up, and a power-on reset would be reported after every following reset.
+If a bootloader has already cleared MCUSR, the cause is 0 and the cache is not used */
+uint8_t reset_cause __attribute__((section(".noinit")));
+void save_reset_cause() __attribute__((naked, used, section(".init3")));
+void save_reset_cause()
+{
+    reset_cause = MCUSR;
+    MCUSR = 0;
+}
+
+#ifdef USE_XMEM
+/* Wait states for PIO mode 3 and 4 at 16 MHz, from the 8 bit strobe width t2 of the CF specification:
+PIO 3: 80 ns, PIO 4: 70 ns. The strobe is about 1 cycle (62.5 ns) + wait states - 10 ns.
+0: none, 1: 1 cycle, 2: 2 cycles, 3: 2 cycles + 1 before new address */
+const uint8_t xmem_wait_states[] = {1, 1}; //PIO 3, PIO 4
 
+/* Read register */
+inline uint8_t register_read(uint8_t addr)
+{
+    return XMEM_REG(addr);
+}
+
+inline void register_write(uint8_t addr, uint8_t value)
+{
+    XMEM_REG(addr) = value;
+}
+
+/* Enable external memory interface */
+void xmem_init()
+{
+    XMCRA = _BV(SRE) | xmem_wait_states[XMEM_PIO_MODE - 3] << SRW10;
+    XMCRB = XMEM_ADDR_BITS << XMM0;
+}
+
+#else
 uint8_t dior_mask, diow_mask;
 volatile uint8_t *dior_mode, *dior_out;
 volatile uint8_t *diow_mode, *diow_out;
@@ -43,7 +90,7 @@ void inline put_register(uint8_t addr)
 {
     REG_ADDR_MODE |= REG_ADDR_MASK;
     REG_ADDR_OUT &= ~REG_ADDR_MASK;
-    REG_ADDR_OUT |= REG_ADDR_MASK & addr;
+    REG_ADDR_OUT |= REG_ADDR_MASK & BUS_ADDR(addr);
 }
 
 /* Read register */
@@ -68,6 +115,7 @@ uint8_t register_write(uint8_t addr, uint8_t value)
     diow(ASSERT);
     diow(NEGATE);
 }
+#endif
 
 
 // Helper functions for Diagnosis 
@@ -81,22 +129,20 @@ void msgout(const char *msg, ...)
     Serial.println(str);
 }
 
-/* waits until BSY is reset and optional flags in status register are set */
-uint8_t status_wait(uint8_t flags = 0)
+/* waits until BSY is reset and optional flags in status register are set.
+Polls continuously, returns 0 as soon as the disk is ready or 1 after timeout [ms] */
+uint8_t status_wait(uint8_t flags = 0, uint16_t timeout = STATUS_TIMEOUT)
 {
-    uint16_t retries = 0;
-    uint8_t regval = register_read(REG_STATUS);
-    while ((regval & BSY) || ((regval & flags) != flags))
+    uint32_t start = millis();
+    uint8_t regval;
+    while (((regval = register_read(REG_STATUS)) & BSY) || ((regval & flags) != flags))
     {
-        if (retries++ >= STATUS_TIMEOUT)
+        if (millis() - start > timeout)
         {
-            msgout("ERROR: status_wait() timeout. Increasing STATUS_TIMEOUT might help");
-            return retries;
+            msgout("ERROR: status_wait() timeout after %u ms", timeout);
+            return 1;
         }
-        delayMicroseconds(1000);
-        regval = register_read(REG_STATUS);
     }
-    //dbgout("status_wait() loops: %d", retries);
     return 0;
 }
 
@@ -143,11 +189,18 @@ void irqfunc()
 }
 #endif
 
-uint8_t hd_init(bool lba)
+/* Drive/Head register: LBA mode and selected device */
+inline uint8_t dev_head()
 {
-    if(mode)
-        return mode;
-    Serial.print("Init disk");
+    return 0xe0 | device << 4;
+}
+
+/* Set up strobe and address pins */
+void bus_init()
+{
+#ifdef USE_XMEM
+    xmem_init();
+#else
     uint8_t dior_port = digitalPinToPort(DIOR_PIN);
     dior_mask = digitalPinToBitMask(DIOR_PIN);
     dior_mode = portModeRegister(dior_port);
@@ -158,39 +211,66 @@ uint8_t hd_init(bool lba)
     diow_out = portOutputRegister(diow_port);
     diow(NEGATE);
     dior(NEGATE);
+#endif
+}
 
-    uint8_t init_timeout = 0;
+uint8_t hd_init(bool lba)
+{
+    if(mode[device])
+        return mode[device];
+    Serial.print("Init disk");
+    bus_init();
 
-    if(!(register_read(REG_STATUS) & BSY))
+    uint8_t status = register_read(REG_STATUS);
+    if(!(status & (BSY | DRDY)))
+    {
+        msgout(" Error: Drive not found");
+        return MODE_NOTINIT;
+    }
+    //Select the device, the device register can only be written when BSY is reset
+    if (status_wait(0, INIT_TIMEOUT))
+    {
+        msgout("ERROR: hd_init() timed out. Try to reset disk (Pull pin 1 to ground)");
+        dump_status();
+        return MODE_NOTINIT;
+    }
+    register_write(REG_DH, dev_head());
+    if (!(register_read(REG_STATUS) & (BSY | DRDY)))
     {
         msgout(" Error: Drive not found");
-        delay(1000);
         return MODE_NOTINIT;
     }
 
-    //Wait max. 30 seconds until drive is ready
-    while ((register_read(REG_STATUS) & 0xc0) != DRDY) //until BSY == 0 and DRDY = 1
+    //Wait until drive is ready (BSY == 0 and DRDY == 1)
+    if (status_wait(DRDY, INIT_TIMEOUT))
     {
-        delay(1000);
-        if (init_timeout++ > 30)
-        {
-            msgout("ERROR: hd_init() timed out. Try to reset disk (Pull pin 1 to ground)");
-            dump_status();
-            return MODE_NOTINIT;
-        }
-        Serial.print(".");
+        msgout("ERROR: hd_init() timed out. Try to reset disk (Pull pin 1 to ground)");
+        dump_status();
+        return MODE_NOTINIT;
     }
+
+    /* Drive was ready and only the Arduino was reset (external, watchdog) since the last configuration: nothing to do.
+    After power-on or brown-out the disk may have lost its settings, even if it is ready and the cache looks valid */
+    bool warm = reset_cause && !(reset_cause & (_BV(PORF) | _BV(BORF)));
+    if (warm && !(status & BSY) && init_cache.magic == CACHE_MAGIC && init_cache.mode[device] == (lba ? MODE_LBA : MODE_CHS))
+    {
+        mode[device] = init_cache.mode[device];
+        msgout(" success (cached)");
+        return mode[device];
+    }
+
     //Set lba mode
+    mode[device] = MODE_CHS;
     if(lba)
     {
-        mode = MODE_LBA;
-        register_write(REG_DH, 0xe0);
+        mode[device] = MODE_LBA;
+        register_write(REG_DH, dev_head());
         register_write(REG_CMD, CMD_INITPARAMS);
         status_wait();
         if (!(register_read(REG_DH) & LBA))
         {
             msgout("Warning: LBA mode not available.");
-            mode = MODE_CHS;
+            mode[device] = MODE_CHS;
         }
     }
     // Set 8 bit data transfer
@@ -200,79 +280,329 @@ uint8_t hd_init(bool lba)
     if (register_read(REG_ERR) & ABRT)
     {
         msgout("Error: 8 Bit transfer mode could not be set");
-        return MODE_NOTINIT;
+        return mode[device] = MODE_NOTINIT;
+    }
+    if (init_cache.magic != CACHE_MAGIC)
+    {
+        init_cache.magic = CACHE_MAGIC;
+        init_cache.mode[MASTER] = init_cache.mode[SLAVE] = MODE_NOTINIT;
     }
+    init_cache.mode[device] = mode[device];
 
 #if defined IRQPIN
     attachInterrupt(digitalPinToInterrupt(IRQPIN), irqfunc, RISING);
 #endif
     msgout(" success");
-    return mode;
+    return mode[device];
 } //hd_init()
 
-uint16_t hd_read_sector(uint32_t sector, uint8_t *buffer, size_t size)
+//CRC-32 (IEEE 802.3), table for 4 bits per step
+const uint32_t crc32_table[16] PROGMEM = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+inline uint32_t crc32_update(uint32_t crc, uint8_t data)
+{
+    crc = pgm_read_dword(&crc32_table[(crc ^ data) & 0x0f]) ^ (crc >> 4);
+    return pgm_read_dword(&crc32_table[(crc ^ (data >> 4)) & 0x0f]) ^ (crc >> 4);
+}
+
+inline uint32_t crc_update(uint8_t mode, uint32_t crc, uint8_t data)
+{
+    return mode == CRC_16 ? _crc_xmodem_update(crc, data) : crc32_update(crc, data);
+}
+
+/* Non-zero start values, so that erased (all zero) sectors don't pass the check */
+inline uint32_t crc_init(uint8_t mode)
+{
+    return mode == CRC_32 ? 0xffffffff : mode == CRC_16 ? 0xffff : 0;
+}
+
+inline uint32_t crc_final(uint8_t mode, uint32_t crc)
 {
-    register_write(REG_LBA_24_27, 0xe0 | (sector >> 24) & 0x0f);
+    return mode == CRC_32 ? ~crc : crc;
+}
+
+inline uint8_t trailer_len(uint8_t mode)
+{
+    return mode == CRC_16 ? 2 : mode == CRC_32 ? 4 : 0;
+}
+
+/* Read from data register into buffer, the checksum is updated on the fly */
+uint32_t read_data(uint8_t *buffer, uint16_t len, uint8_t mode, uint32_t crc)
+{
+    uint8_t b;
+    switch (mode)
+    {
+    case CRC_16:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            buffer[i] = b = register_read(REG_D);
+            crc = _crc_xmodem_update(crc, b);
+        }
+        break;
+    case CRC_32:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            buffer[i] = b = register_read(REG_D);
+            crc = crc32_update(crc, b);
+        }
+        break;
+    default:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            buffer[i] = register_read(REG_D);
+        }
+    }
+    return crc;
+}
+
+/* Write buffer to data register, the checksum is updated on the fly */
+uint32_t write_data(const uint8_t *buffer, uint16_t len, uint8_t mode, uint32_t crc)
+{
+    uint8_t b;
+    switch (mode)
+    {
+    case CRC_16:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            register_write(REG_D, b = buffer[i]);
+            crc = _crc_xmodem_update(crc, b);
+        }
+        break;
+    case CRC_32:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            register_write(REG_D, b = buffer[i]);
+            crc = crc32_update(crc, b);
+        }
+        break;
+    default:
+        for (uint16_t i = 0; i < len; i++)
+        {
+            register_write(REG_D, buffer[i]);
+        }
+    }
+    return crc;
+}
+
+uint16_t hd_payload_len(uint8_t mode)
+{
+    return SECTOR_LEN - trailer_len(mode);
+}
+
+/* Write LBA and sector count (0: 256 sectors) to the task file and issue command */
+void send_command(uint8_t cmd, uint32_t sector, uint8_t count = 1)
+{
+    status_wait(); //Task file can only be written when BSY is reset
+    register_write(REG_SC, count);
+    register_write(REG_LBA_24_27, dev_head() | ((sector >> 24) & 0x0f));
     register_write(REG_LBA_16_23, sector >> 16);
     register_write(REG_LBA_8_15, sector >> 8);
     register_write(REG_LBA_0_7, sector);
-    register_write(REG_CMD, CMD_READ);
+    register_write(REG_CMD, cmd);
+}
+
+/* Read sector, verify checksum trailer unless mode is CRC_NONE */
+uint16_t read_sector(uint32_t sector, uint8_t *buffer, size_t size, uint8_t mode)
+{
+    send_command(CMD_READ, sector);
     if (status_wait(DRQ))
     {
         msgout("ERROR: cannot find sector. Maybe it is out of range?");
         return 0;
     }
-    for (int i = 0; i < size; i++)
+    if (!mode)
+    {
+        read_data(buffer, size, CRC_NONE, 0);
+        return size;
+    }
+    //Verify: the whole sector must pass through the checksum
+    uint16_t payload = hd_payload_len(mode);
+    uint32_t crc = read_data(buffer, payload, mode, crc_init(mode));
+    uint32_t stored = 0;
+    for (uint8_t i = 0; i < trailer_len(mode); i++)
+        stored |= (uint32_t)register_read(REG_D) << (8 * i);
+    if (crc_final(mode, crc) != stored)
     {
-        buffer[i] = register_read(REG_D);
+        msgout("ERROR: checksum error in sector %lu", sector);
+        return 0;
     }
-    return size;
+    return payload;
 }
 
-uint16_t hd_read_multiple(uint32_t sector, uint8_t *buffer)
+/* Write sector, stamp checksum trailer unless mode is CRC_NONE */
+uint8_t write_sector(uint32_t sector, const uint8_t *buffer, uint8_t mode)
 {
-    static uint32_t sector_ = sector;
-    static uint32_t current = sector;
-    if(sector != sector_)
+    send_command(CMD_WRITE, sector);
+    if (status_wait(DRQ))
     {
-        sector_ = sector;
-        current = sector;
+        msgout("ERROR: Writing to drive failed");
+        return 0;
     }
-    return hd_read_sector(current++, buffer);
+    uint32_t crc = crc_final(mode, write_data(buffer, hd_payload_len(mode), mode, crc_init(mode)));
+    for (uint8_t i = 0; i < trailer_len(mode); i++)
+        register_write(REG_D, crc >> (8 * i));
+    return 1;
+}
+
+uint16_t hd_read_sector(uint32_t sector, uint8_t *buffer, size_t size)
+{
+    return read_sector(sector, buffer, size, CRC_NONE);
+}
+
+uint16_t hd_read_sector_crc(uint32_t sector, uint8_t *buffer, uint8_t mode)
+{
+    return read_sector(sector, buffer, SECTOR_LEN, mode);
 }
 
 uint8_t hd_write_sector(uint32_t sector, const uint8_t *buffer)
 {
-    uint8_t mode = register_read(REG_LBA_24_27) & 0xf0;
-    register_write(REG_LBA_24_27, mode | (sector >> 24) & 0x0f);
-    register_write(REG_LBA_16_23, sector >> 16);
-    register_write(REG_LBA_8_15, sector >> 8);
-    register_write(REG_LBA_0_7, sector);
-    register_write(REG_CMD, CMD_WRITE);
+    return write_sector(sector, buffer, CRC_NONE);
+}
+
+uint8_t hd_write_sector_crc(uint32_t sector, const uint8_t *buffer, uint8_t mode)
+{
+    return write_sector(sector, buffer, mode);
+}
+
+uint8_t hd_fill_sectors(uint32_t sector, uint32_t count, uint16_t pattern, uint8_t mode)
+{
+    uint8_t lo = pattern, hi = pattern >> 8;
+    uint16_t payload = hd_payload_len(mode);
+    //All sectors are equal, so the checksum is calculated only once
+    uint32_t crc = crc_init(mode);
+    if (mode)
+    {
+        for (uint16_t i = 0; i < payload; i++)
+            crc = crc_update(mode, crc, i & 1 ? hi : lo);
+        crc = crc_final(mode, crc);
+    }
+    while (count)
+    {
+        uint16_t n = count > 256 ? 256 : count;
+        send_command(CMD_WRITE, sector, n);
+        for (uint16_t s = 0; s < n; s++)
+        {
+            if (status_wait(DRQ))
+            {
+                msgout("ERROR: Writing to drive failed");
+                return 0;
+            }
+            for (uint16_t i = 0; i < payload; i += 2)
+            {
+                register_write(REG_D, lo);
+                register_write(REG_D, hi);
+            }
+            for (uint8_t i = 0; i < trailer_len(mode); i++)
+                register_write(REG_D, crc >> (8 * i));
+        }
+        sector += n;
+        count -= n;
+    }
+    return status_wait() ? 0 : 1;
+}
+
+uint32_t hd_capacity()
+{
+    uint32_t sectors = 0;
+    status_wait();
+    register_write(REG_DH, dev_head());
+    register_write(REG_CMD, CMD_IDENT);
     if (status_wait(DRQ))
     {
-        msgout("ERROR: Writing to drive failed");
+        msgout("ERROR: IDENTIFY DEVICE failed");
+        return 0;
+    }
+    //Words 60-61: Total number of user addressable sectors
+    for (uint16_t i = 0; i < SECTOR_LEN; i++)
+    {
+        uint8_t b = register_read(REG_D);
+        if (i >= 120 && i < 124)
+            sectors |= (uint32_t)b << (8 * (i - 120));
+    }
+    return sectors;
+}
+
+uint8_t hd_reset()
+{
+#ifdef CTRL_BLOCK
+    bus_init();
+    mode[MASTER] = mode[SLAVE] = MODE_NOTINIT; //Both devices are reset
+    init_cache.magic = 0;
+    register_write(REG_CTRL, SRST);
+    delayMicroseconds(5);
+    register_write(REG_CTRL, NIEN);
+    delay(2);
+    if (status_wait(DRDY, INIT_TIMEOUT))
+    {
+        msgout("ERROR: hd_reset() timed out");
         return 0;
     }
-    for (int i = 0; i < SECTOR_LEN; i++)
+    return 1;
+#else
+    msgout("Error: Soft reset requires CS0 and CS1 wiring (CTRL_BLOCK)");
+    return 0;
+#endif
+}
+
+void hd_select(uint8_t dev)
+{
+    device = dev ? SLAVE : MASTER;
+}
+
+/* Read or write n sectors with one command */
+uint8_t transfer_sectors(uint8_t cmd, uint8_t dev, uint32_t sector, uint8_t *buffer, uint8_t n)
+{
+    device = dev;
+    send_command(cmd, sector, n);
+    for (uint8_t s = 0; s < n; s++, buffer += SECTOR_LEN)
     {
-        register_write(REG_D, buffer[i]);
+        if (status_wait(DRQ))
+            return 0;
+        if (cmd == CMD_READ)
+            read_data(buffer, SECTOR_LEN, CRC_NONE, 0);
+        else
+            write_data(buffer, SECTOR_LEN, CRC_NONE, 0);
     }
     return 1;
 }
 
-uint8_t hd_write_multiple(uint32_t sector, const uint8_t *buffer)
+uint8_t hd_copy_sectors(uint8_t src_dev, uint32_t src, uint8_t dst_dev, uint32_t dst, uint32_t count)
 {
-    static uint32_t sector_ = sector;
-    static uint32_t current = sector;
-    if(sector != sector_)
+    uint8_t buffer[COPY_BUFFERS][SECTOR_LEN]; //Checksum trailers are copied as they are
+    src_dev = src_dev ? SLAVE : MASTER;
+    dst_dev = dst_dev ? SLAVE : MASTER;
+    if (!mode[src_dev] || !mode[dst_dev])
     {
-        sector_ = sector;
-        current = sector;
+        msgout("ERROR: hd_copy_sectors() disk not initialized");
+        return 0;
     }
-    return hd_write_sector(current++, buffer);
+    uint8_t selected = device;
+    //Overlapping ranges on the same device are copied from the end, like memmove()
+    bool backwards = src_dev == dst_dev && dst > src && dst < src + count;
+    uint8_t ret = 1;
+    while (count && ret)
+    {
+        uint8_t n = count > COPY_BUFFERS ? COPY_BUFFERS : count;
+        uint32_t offset = backwards ? count - n : 0;
+        ret = transfer_sectors(CMD_READ, src_dev, src + offset, buffer[0], n) &&
+              transfer_sectors(CMD_WRITE, dst_dev, dst + offset, buffer[0], n);
+        if (!backwards)
+        {
+            src += n;
+            dst += n;
+        }
+        count -= n;
+    }
+    if (ret && status_wait()) //Wait for the last write
+        ret = 0;
+    if (!ret)
+        msgout("ERROR: hd_copy_sectors() failed");
+    device = selected;
+    return ret;
 }
 
 bool hd_isInit(){
-    return mode;
+    return mode[device];
 }
@@ -19,11 +19,53 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
 //User constants
 //#define USE_FAT  //Uncomment to use FAT Filesystems with SDFat Library V2
 #define STATUS_TIMEOUT 100 //Time [ms] to wait for status change. Increase for slow disks
+#define INIT_TIMEOUT 30000 //Time [ms] to wait until the disk is ready after power up
+#define COPY_BUFFERS 2 //Sector buffers on the stack in hd_copy_sectors(). More buffers need less commands
+//#define CTRL_BLOCK //Uncomment if CS0 and CS1 are connected (see below). Required for hd_reset()
+//#define USE_XMEM //Uncomment to access the disk through the external memory interface (different wiring, see below)
+#define XMEM_PIO_MODE 4 //Fastest PIO mode (3 or 4) supported by the disk. Sets the wait states in XMEM mode. PIO 0-2 is too slow for XMEM at 16 MHz
 
 #ifdef USE_FAT 
 #include "CFFatDriver.h"
 #endif
 
+/* Chip selects: Without CTRL_BLOCK, CS0 is tied to ground and CS1 to +5V,
+so only the command block registers can be accessed. With CTRL_BLOCK,
+CS0 and CS1 are driven by address bits 3 and 4 */
+#ifdef CTRL_BLOCK
+#define BUS_ADDR(addr) (((addr) & 0x0f) | (~(addr) & 0x08) << 1)
+#else
+#define BUS_ADDR(addr) ((addr) & 0x07)
+#endif
+
+#ifdef USE_XMEM
+/* External memory interface: Strobes and register address are generated by the hardware,
+a register access is a single load or store instruction.
+Dev. Pin    |   Signal  | Arduino Pin
+17 - 3      |   D0-D7   | 22-29 (PA0-PA7, AD0-AD7), odd pin numbers
+35          |   A0      | 37 (PC0, A8)
+33          |   A1      | 36 (PC1, A9)
+36          |   A2      | 35 (PC2, A10)
+23          |   DIOW    | 41 (PG0, WR)
+25          |   DIOR    | 40 (PG1, RD)
+ALE is not needed because the low address byte is not connected*/
+/* Optional, for access to the control block registers (CTRL_BLOCK)
+38          |   CS1     | 33 (PC4, A12)
+37          |   CS0     | 34 (PC3, A11)*/
+#if XMEM_PIO_MODE < 3 || XMEM_PIO_MODE > 4
+/* In 8 bit mode, PIO 0-2 require a strobe of 290 ns, but the longest XMEM strobe
+at 16 MHz (SRW = 3) is about 177 ns */
+#error "XMEM_PIO_MODE must be 3 or 4, use GPIO mode for slower disks"
+#endif
+#define XMEM_BASE 0x8000 //Any address above the internal SRAM, only A8-A12 are used
+#define XMEM_REG(addr) (*(volatile uint8_t *)(XMEM_BASE | (uint16_t)BUS_ADDR(addr) << 8))
+#ifdef CTRL_BLOCK
+#define XMEM_ADDR_BITS 0x03 //XMM: A8-A12 used, PC5-PC7 released
+#else
+#define XMEM_ADDR_BITS 0x05 //XMM: A8-A10 used, PC3-PC7 released
+#endif
+
+#else
 /* 8 Byte Data Bus */
 #define DD_LSB_MODE DDRL //Device Pin 17 - 3, odd pin numbers, Ardu Pin 49-42
 #define DD_LSB_OUT PORTL //Ardiuno -> hd
@@ -39,11 +81,19 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
 Dev. Pin    |   Bit     | Arduino Pin
 35          |   0       | 22 (PA0)
 33          |   1       | 23 (PA1)
-36          |   2       | 24 (PA2)*/
+36          |   2       | 24 (PA2)
+Optional, for access to the control block registers (CTRL_BLOCK)
+37          |   CS0     | 25 (PA3)
+38          |   CS1     | 26 (PA4)*/
 //Port and mask for Address pins
 #define REG_ADDR_MODE DDRA
+#ifdef CTRL_BLOCK
+#define REG_ADDR_MASK 0x1f
+#else
 #define REG_ADDR_MASK 0x07
+#endif
 #define REG_ADDR_OUT PORTA
+#endif
 
 //Command block registers
 #define REG_D 0b000   //Data register
@@ -62,7 +112,7 @@ Dev. Pin    |   Bit     | Arduino Pin
 #define REG_STATUS 0b111    //Read: Status
 #define REG_CMD 0b111       //Write: Command
 
-//Control block registers (not used)
+//Control block registers (only with CTRL_BLOCK)
 #define REG_IDLE 0b1000     //Data Bus High Imped
 #define REG_ALT_STAT 0b1110 //Read: Alternate Status
 #define REG_CTRL 0b1110     //Write: Device Control
@@ -97,12 +147,60 @@ Dev. Pin    |   Bit     | Arduino Pin
 
 #define SECTOR_LEN 512
 
-/** Init Harddisk
+//Devices on the bus, see hd_select()
+#define MASTER 0
+#define SLAVE 1
+
+//Sector integrity modes, see hd_read_sector_crc()
+#define CRC_NONE 0 //No checksum
+#define CRC_16 1   //CRC-16/CCITT-FALSE (start value 0xffff) in the last 2 bytes of a sector
+#define CRC_32 2   //CRC-32 in the last 4 bytes of a sector
+
+/** Init Harddisk. Waits max. INIT_TIMEOUT until the disk is ready.
+ * If the disk has been configured before the last external or watchdog reset of the Arduino, the configuration is skipped.
+ * After power-on or brown-out, the disk is always configured
  * \param[in] mode: false: CHS mode, true: LBA (default)
  * \return 0: error, 1: LBA, 2: CHS
  */
 uint8_t hd_init(bool lba = true);
 
+/** Write a repeating pattern to consecutive sectors, no buffer needed.
+ * Uses one command for up to 256 sectors
+ * \param[in] sector: First sector to write
+ * \param[in] count: Number of sectors
+ * \param[in] pattern: Low byte is written to even, high byte to odd offsets. 0 to erase
+ * \param[in] mode: CRC_NONE, or CRC_16 / CRC_32 to stamp a checksum trailer like hd_write_sector_crc()
+ * \return 1 on success, 0 on error
+*/
+uint8_t hd_fill_sectors(uint32_t sector, uint32_t count, uint16_t pattern = 0, uint8_t mode = CRC_NONE);
+
+/** Read size of the disk with IDENTIFY DEVICE
+ * \return number of sectors (LBA) or 0 on error
+*/
+uint32_t hd_capacity();
+
+/** Select device for all subsequent operations, hd_init() must be called for each device
+ * \param[in] dev: MASTER (default) or SLAVE
+*/
+void hd_select(uint8_t dev);
+
+/** Copy sectors within a disk or between master and slave.
+ * Reads and writes COPY_BUFFERS sectors with one command. Overlapping ranges are handled
+ * \param[in] src_dev: MASTER or SLAVE
+ * \param[in] src: First sector to read
+ * \param[in] dst_dev: MASTER or SLAVE
+ * \param[in] dst: First sector to write
+ * \param[in] count: Number of sectors
+ * \return 1 on success, 0 on error or if one of the devices is not initialized
+*/
+uint8_t hd_copy_sectors(uint8_t src_dev, uint32_t src, uint8_t dst_dev, uint32_t dst, uint32_t count);
+
+/** Soft reset through the Device Control register (SRST). Requires CTRL_BLOCK wiring.
+ * Call hd_init() afterwards
+ * \return 1 on success, 0 on error
+ */
+uint8_t hd_reset();
+
 /** 
  * \return true: HD can be used, False: HD is not initialized or error
  * /
@@ -116,7 +214,8 @@ bool hd_isinit();
 */
 uint16_t hd_read_sector(uint32_t sector, uint8_t *buffer, size_t size = SECTOR_LEN);
 
-/** Read bytes from multiple sectors: Every subsequent call returns the next sector
+/** Read bytes from multiple sectors: Every subsequent call returns the next sector.
+ * There is only one such stream, use HdStream (CFStream.h) for independent streams
  * \param[in] sector: First Sector or CHS to be read
  * \param[out] *buffer: buffer with bytes read
  * \return number of bytes read or 0 on error
@@ -130,13 +229,40 @@ uint16_t hd_read_multiple(uint32_t sector, uint8_t *buffer);
 */
 uint8_t hd_write_sector(uint32_t sector, const uint8_t *buffer);
 
-/** Write bytes to multiple sectors: Every subsequent call writes the next sector
+/** Write bytes to multiple sectors: Every subsequent call writes the next sector.
+ * There is only one such stream, use HdStream (CFStream.h) for independent streams
  * \param[in] sector: First Sector or CHS to be write
  * \param[in] *buffer: buffer with bytes to be written
  * \return 1 on success, 0 on error
 */
 uint8_t hd_write_multiple(uint32_t sector, const uint8_t *buffer);
 
+/** Read sector and verify the checksum in its trailer.
+ * The checksum is calculated during the transfer
+ * \param[in] sector: Sector to be read
+ * \param[out] *buffer: buffer with bytes read, SECTOR_LEN bytes
+ * \param[in] mode: CRC_16 or CRC_32
+ * \return hd_payload_len(mode) or 0 on error or checksum mismatch
+*/
+uint16_t hd_read_sector_crc(uint32_t sector, uint8_t *buffer, uint8_t mode = CRC_16);
+
+/** Write sector with the checksum in its trailer.
+ * The checksum is calculated during the transfer
+ * \param[in] sector: Sector to write
+ * \param[in] *buffer: hd_payload_len(mode) bytes to write
+ * \param[in] mode: CRC_16 or CRC_32
+ * \return 1 on success, 0 on error
+*/
+uint8_t hd_write_sector_crc(uint32_t sector, const uint8_t *buffer, uint8_t mode = CRC_16);
+
+/** \return usable bytes per sector, SECTOR_LEN minus checksum trailer
+ * \param[in] mode: CRC_NONE, CRC_16 or CRC_32
+*/
+uint16_t hd_payload_len(uint8_t mode);
+
+//MCUSR at startup, the library clears MCUSR
+extern uint8_t reset_cause;
+
 //** Sprintf formatted message */
 void msgout(const char *, ...);
 
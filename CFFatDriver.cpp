@@ -223,9 +223,13 @@ void HdDrive::send(uint8_t data)
     argument += data;
     arg_pos++;
   }
-  else //Ignore Checksum
+  else //Ignore Checksum, command complete
   {
     arg_pos = 0;
+    if (command == CMD18)
+      read_stream.open(argument);
+    else if (command == CMD25)
+      write_stream.open(argument);
     //msgout("Argument: 0x%08x", argument);
   }
   //msgout("data: %02x, argument: %08lx\n", data, argument);
@@ -242,7 +246,7 @@ void HdDrive::send(const uint8_t *buf, size_t count)
     SPI.transfer(buf[i]);
   }
 #else
-  hd_write_multiple(argument, buf);
+  write_stream.write(buf, count);
 #endif
 }
 
@@ -257,7 +261,7 @@ uint8_t HdDrive::receive(uint8_t *buf, size_t count)
   }
 #else
   read_progress = 1;
-  hd_read_multiple(argument, buf);
+  read_stream.read(buf, count);
 #endif
   //hexdump(buf, count);
   return 0;
@@ -13,6 +13,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
 
 #include "Arduino.h"
 #include "CFCard.h"
+#include "CFStream.h"
 
 #ifdef USE_FAT
 #include "SdFat.h"
@@ -60,6 +61,8 @@ private:
   bool read_progress = false; //True: (multiple) Read in progress
   uint32_t sect_written; // Number of sectors written 
   bool write_progress = false; //True: (multiple) Write in progress
+  HdStream read_stream; //Opened by CMD18 at argument
+  HdStream write_stream; //Opened by CMD25 at argument
 
   //uint8_t cmd_send_response(uint8_t, uint32_t);
   uint8_t cmd_respond(uint8_t &, const uint8_t *);
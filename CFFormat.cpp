@@ -0,0 +1,160 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+#include "CFFormat.h"
+
+static void put_u16(uint8_t *p, uint16_t u)
+{
+    p[0] = u;
+    p[1] = u >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t u)
+{
+    put_u16(p, u);
+    put_u16(p + 2, u >> 16);
+}
+
+/* CHS address for partition table with 255 heads and 63 sectors per track */
+static void put_chs(uint8_t *p, uint32_t lba)
+{
+    uint16_t c = lba / (255UL * 63);
+    uint8_t h = (lba / 63) % 255;
+    uint8_t s = lba % 63 + 1;
+    if (c > 1023) //Not addressable with CHS
+    {
+        c = 1023;
+        h = 254;
+        s = 63;
+    }
+    p[0] = h;
+    p[1] = s | (c >> 2 & 0xc0);
+    p[2] = c;
+}
+
+/* Sectors per cluster, like Microsoft's table for FAT32 */
+static uint8_t cluster_size(uint32_t sectors)
+{
+    if (sectors <= 532480UL)
+        return 1;
+    if (sectors <= 16777216UL)
+        return 8;
+    if (sectors <= 33554432UL)
+        return 16;
+    if (sectors <= 67108864UL)
+        return 32;
+    return 64;
+}
+
+static uint8_t write_sector(uint32_t sector, const uint8_t *buffer)
+{
+    if (!hd_write_sector(sector, buffer))
+    {
+        msgout("ERROR: hd_format() could not write sector %lu", sector);
+        return 0;
+    }
+    return 1;
+}
+
+/* Write MBR, boot sectors, FSInfo and the first FAT sectors. Everything else is already erased */
+static uint8_t write_structures(uint32_t part_len, uint8_t spc, uint32_t fat_len, uint32_t clusters, const char *label)
+{
+    uint8_t sect[SECTOR_LEN];
+    const uint32_t part = FORMAT_PART_START;
+
+    //Master boot record with one partition
+    memset(sect, 0, SECTOR_LEN);
+    uint8_t *entry = sect + 446;
+    put_chs(entry + 1, part);
+    entry[4] = 0x0c; //FAT32 LBA
+    put_chs(entry + 5, part + part_len - 1);
+    put_u32(entry + 8, part);
+    put_u32(entry + 12, part_len);
+    sect[510] = 0x55;
+    sect[511] = 0xaa;
+    if (!write_sector(0, sect))
+        return 0;
+
+    //Boot sector and backup
+    memset(sect, 0, SECTOR_LEN);
+    memcpy(sect, "\xeb\x58\x90" "CFCARD  ", 11);
+    put_u16(sect + 11, SECTOR_LEN);
+    sect[13] = spc;
+    put_u16(sect + 14, FORMAT_RSVD_SECTORS);
+    sect[16] = 2;    //Number of FATs
+    sect[21] = 0xf8; //Media: fixed disk
+    put_u16(sect + 24, 63);
+    put_u16(sect + 26, 255);
+    put_u32(sect + 28, part);
+    put_u32(sect + 32, part_len);
+    put_u32(sect + 36, fat_len);
+    put_u32(sect + 44, 2); //Root directory cluster
+    put_u16(sect + 48, 1); //FSInfo sector
+    put_u16(sect + 50, 6); //Backup boot sector
+    sect[64] = 0x80;
+    sect[66] = 0x29;
+    put_u32(sect + 67, micros()); //Volume ID
+    memset(sect + 71, ' ', 11);
+    for (uint8_t i = 0; i < 11 && label[i]; i++)
+        sect[71 + i] = label[i];
+    memcpy(sect + 82, "FAT32   ", 8);
+    sect[510] = 0x55;
+    sect[511] = 0xaa;
+    if (!write_sector(part, sect) || !write_sector(part + 6, sect))
+        return 0;
+
+    //FSInfo and backup
+    memset(sect, 0, SECTOR_LEN);
+    put_u32(sect, 0x41615252);
+    put_u32(sect + 484, 0x61417272);
+    put_u32(sect + 488, clusters - 1); //Free clusters, root directory uses one
+    put_u32(sect + 492, 3);            //Next free cluster
+    put_u32(sect + 508, 0xaa550000);
+    if (!write_sector(part + 1, sect) || !write_sector(part + 7, sect))
+        return 0;
+
+    //First sector of both FATs: media, reserved and end of root directory cluster chain
+    memset(sect, 0, SECTOR_LEN);
+    put_u32(sect, 0x0ffffff8);
+    put_u32(sect + 4, 0x0fffffff);
+    put_u32(sect + 8, 0x0fffffff);
+    uint32_t fat = part + FORMAT_RSVD_SECTORS;
+    return write_sector(fat, sect) && write_sector(fat + fat_len, sect);
+}
+
+uint8_t hd_format(const char *label)
+{
+    uint32_t total = hd_capacity();
+    if (total <= FORMAT_PART_START)
+    {
+        msgout("ERROR: hd_format() could not read disk size");
+        return 0;
+    }
+    uint32_t part_len = total - FORMAT_PART_START;
+    uint8_t spc = cluster_size(part_len);
+    //FAT size, see Microsoft FAT specification
+    uint32_t tmp = (256UL * spc + 2) / 2;
+    uint32_t fat_len = (part_len - FORMAT_RSVD_SECTORS + tmp - 1) / tmp;
+    uint32_t data = FORMAT_PART_START + FORMAT_RSVD_SECTORS + 2 * fat_len;
+    uint32_t clusters = (part_len - FORMAT_RSVD_SECTORS - 2 * fat_len) / spc;
+    if (clusters < FORMAT_MIN_CLUSTERS)
+    {
+        msgout("ERROR: Disk too small for FAT32");
+        return 0;
+    }
+    msgout("Formatting %lu sectors, %u sectors per cluster", part_len, spc);
+
+    return hd_fill_sectors(FORMAT_PART_START, data - FORMAT_PART_START) && //Reserved sectors and FATs
+           hd_fill_sectors(data, spc) &&                                   //Root directory
+           write_structures(part_len, spc, fat_len, clusters, label);
+}
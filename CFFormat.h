@@ -0,0 +1,30 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+#ifndef CFFormat_h
+#define CFFormat_h
+#include "CFCard.h"
+
+#define FORMAT_PART_START 2048 //First sector of the partition (1 MB aligned)
+#define FORMAT_RSVD_SECTORS 32
+#define FORMAT_MIN_CLUSTERS 65525 //Less clusters is FAT16
+
+/** Create a master boot record with one FAT32 partition over the whole disk
+ * and format it, so that it can be used with the SdFat library.
+ * ALL DATA ON THE DISK IS LOST. Needs 64 MB or more.
+ * \param[in] label: Volume label, max. 11 characters
+ * \return 1 on success, 0 on error
+*/
+uint8_t hd_format(const char *label = "NO NAME");
+
+#endif
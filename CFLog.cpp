@@ -0,0 +1,226 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+#include "CFLog.h"
+
+#define LOG_DATA_START sizeof(log_header)
+#define LOG_DATA_END (SECTOR_LEN - 2) //CRC-16 trailer
+#define HEADER(sect) ((log_header *)(sect))
+
+/* Read sector of the log and check checksum and header
+return 1 if the sector is valid */
+uint8_t HdLog::read(uint32_t index, uint8_t *sect)
+{
+    uint8_t ret = hd_read_sector_crc(first + index, sect, CRC_16) != 0;
+    log_header *h = HEADER(sect);
+    return ret && h->magic == LOG_MAGIC && h->seq && h->len >= LOG_DATA_START && h->len <= LOG_DATA_END &&
+           h->carry >= LOG_DATA_START && h->carry <= h->len;
+}
+
+/* Advance head to the next sector of the ring */
+void HdLog::next_slot()
+{
+    head = (head + 1) % count;
+    if (head == tail && head_seq) //Overwrite oldest sector
+        tail = (tail + 1) % count;
+    head_seq++;
+}
+
+uint8_t HdLog::write_head()
+{
+    HEADER(buffer)->magic = LOG_MAGIC;
+    HEADER(buffer)->seq = head_seq;
+    uint8_t ret = hd_write_sector_crc(first + head, buffer, CRC_16);
+    if (ret)
+        dirty = false;
+    return ret;
+}
+
+uint8_t HdLog::format(uint32_t first, uint32_t count)
+{
+    if (count < 2)
+        return 0;
+    return hd_fill_sectors(first, count) && mount(first, count);
+}
+
+uint8_t HdLog::mount(uint32_t first, uint32_t count)
+{
+    this->first = first;
+    this->count = count;
+    head = count - 1;
+    head_seq = 0;
+    tail = 0;
+    dirty = false;
+    synced = 0;
+    if (count < 2)
+        return 0;
+
+    /* Sectors 0 - head are from the current round and numbered consecutively,
+    the sectors after head are from the previous round, empty or partially written */
+    uint8_t *sect = it_buffer;
+    if (read(0, sect))
+    {
+        uint32_t seq0 = HEADER(sect)->seq;
+        uint32_t lo = 0, hi = count;
+        while (hi - lo > 1)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (read(mid, sect) && HEADER(sect)->seq == seq0 + mid)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        head = lo;
+        head_seq = seq0 + lo;
+        if (head_seq > head + 1) //Wrapped around, oldest sector follows head
+        {
+            tail = (head + 1) % count;
+            if (!read(tail, sect))
+                tail = (tail + 1) % count;
+        }
+    }
+    else if (read(count - 1, sect)) //Sector 0 partially written at wraparound
+    {
+        head_seq = HEADER(sect)->seq;
+        tail = 1; //Oldest sector follows the torn one
+    }
+    else //Empty
+    {
+        rewind();
+        return 1;
+    }
+    //Continue appending to the newest sector
+    if (!read(head, buffer))
+        return 0;
+    synced = HEADER(buffer)->len;
+    rewind();
+    return 1;
+}
+
+uint8_t HdLog::append(const void *record, uint8_t len)
+{
+    if (!len)
+        return 0;
+    if (!head_seq || HEADER(buffer)->len + 1 + len > LOG_DATA_END)
+    {
+        if (!sync())
+            return 0;
+        next_slot();
+        synced = 0;
+        HEADER(buffer)->len = HEADER(buffer)->carry = LOG_DATA_START;
+    }
+    uint16_t offset = HEADER(buffer)->len;
+    buffer[offset] = len;
+    memcpy(buffer + offset + 1, record, len);
+    HEADER(buffer)->len += 1 + len;
+    dirty = true;
+    return 1;
+}
+
+uint8_t HdLog::sync()
+{
+    if (!dirty)
+        return 1;
+    if (synced) //Don't overwrite records on disk, continue in the next sector
+    {
+        HEADER(buffer)->carry = synced;
+        next_slot();
+        synced = 0;
+    }
+    if (!write_head())
+        return 0;
+    synced = HEADER(buffer)->len;
+    return 1;
+}
+
+/* Load sector for iteration. The head sector is taken from RAM, because it may not be written yet */
+void HdLog::load(uint32_t index)
+{
+    it_sector = index;
+    if (index == head && head_seq)
+        memcpy(it_buffer, buffer, SECTOR_LEN);
+    else if (!read(index, it_buffer))
+        HEADER(it_buffer)->len = HEADER(it_buffer)->carry = LOG_DATA_START; //Skip invalid sectors
+}
+
+/* Copy record at offset, return its length or 0 if the record is invalid */
+uint8_t HdLog::copy_record(uint16_t offset, void *record, uint8_t size)
+{
+    uint8_t len = it_buffer[offset];
+    if (!len || offset + 1 + len > HEADER(it_buffer)->len)
+        return 0;
+    memcpy(record, it_buffer + offset + 1, len < size ? len : size);
+    return len;
+}
+
+void HdLog::rewind()
+{
+    load(tail);
+    it_offset = LOG_DATA_START;
+}
+
+void HdLog::end()
+{
+    load(head);
+    it_offset = HEADER(it_buffer)->len;
+}
+
+uint8_t HdLog::next(void *record, uint8_t size)
+{
+    if (!head_seq)
+        return 0;
+    for (;;)
+    {
+        while (it_offset >= HEADER(it_buffer)->len)
+        {
+            if (it_sector == head)
+                return 0;
+            load((it_sector + 1) % count);
+            it_offset = HEADER(it_buffer)->carry; //Skip records of the previous sector
+        }
+        uint8_t len = copy_record(it_offset, record, size);
+        if (len)
+        {
+            it_offset += 1 + len;
+            return len;
+        }
+        it_offset = HEADER(it_buffer)->len; //Corrupt, skip rest of sector
+    }
+}
+
+uint8_t HdLog::prev(void *record, uint8_t size)
+{
+    if (!head_seq)
+        return 0;
+    for (;;)
+    {
+        while (it_offset <= (it_sector == tail ? LOG_DATA_START : HEADER(it_buffer)->carry))
+        {
+            if (it_sector == tail)
+                return 0;
+            load((it_sector + count - 1) % count);
+            it_offset = HEADER(it_buffer)->len;
+        }
+        //Records are only linked forward: find the one that ends at it_offset
+        uint16_t offset = LOG_DATA_START;
+        while (it_buffer[offset] && offset + 1 + it_buffer[offset] < it_offset)
+            offset += 1 + it_buffer[offset];
+        uint8_t len = copy_record(offset, record, size);
+        if (len && offset + 1 + len == it_offset)
+        {
+            it_offset = offset;
+            return len;
+        }
+        it_offset = LOG_DATA_START; //Corrupt, skip rest of sector
+    }
+}
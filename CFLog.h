@@ -0,0 +1,110 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+/* Circular log in a range of sectors. When the range is full, the oldest sector is overwritten.
+Every sector starts with a header with a sequence number and ends with a CRC-16 (see hd_write_sector_crc()),
+so mount() finds the newest sector with a binary search and ignores sectors that were only partially written.
+After an interrupted write, mount() continues after the last complete sector and iteration starts
+after the torn one, e.g. with a torn sector 0 at wraparound the newest sector is the last one and the oldest is sector 1.
+Records of 1 - LOG_MAX_RECORD bytes are stored with a length byte, they don't span sectors.
+Written sectors are never overwritten until the ring wraps around: sync() writes the newest sector to the
+next one with the following sequence number, carrying its records forward. A power failure during this
+write loses only the records added since the last sync(). Every sync() uses up one sector, so frequent
+syncs shorten the history that fits into the ring. */
+
+#ifndef CFLog_h
+#define CFLog_h
+#include "CFCard.h"
+
+#define LOG_MAGIC 0x474c //"LG"
+#define LOG_MAX_RECORD 255
+
+struct log_header
+{
+  uint16_t magic;
+  uint32_t seq; //Sequence number, the first sector written is 1
+  uint16_t len; //Bytes used including header
+  uint16_t carry; //Records before this offset are copies from the previous sector
+};
+
+class HdLog
+{
+public:
+  /** Erase the sectors and mount an empty log
+   * \param[in] first: First sector of the log
+   * \param[in] count: Number of sectors, at least 2
+   * \return 1 on success, 0 on error
+  */
+  uint8_t format(uint32_t first, uint32_t count);
+
+  /** Find the newest sector and load it, so that appending continues after the last record
+   * \param[in] first: First sector of the log
+   * \param[in] count: Number of sectors, same as for format()
+   * \return 1 on success, 0 on error
+  */
+  uint8_t mount(uint32_t first, uint32_t count);
+
+  /** Append a record. The sector is written when it is full or sync() is called
+   * \param[in] *record: data
+   * \param[in] len: number of bytes, 1 - LOG_MAX_RECORD
+   * \return 1 on success, 0 on error
+  */
+  uint8_t append(const void *record, uint8_t len);
+
+  /** Write records that have not been written yet.
+   * If the newest sector has been written before, its records are written to the next sector
+   * \return 1 on success, 0 on error
+  */
+  uint8_t sync();
+
+  /** Start iteration at the oldest record */
+  void rewind();
+
+  /** Start iteration after the newest record */
+  void end();
+
+  /** Get next record, towards the newest
+   * \param[out] *record: buffer for the record
+   * \param[in] size: size of the buffer, longer records are truncated
+   * \return record length or 0 if there are no more records
+  */
+  uint8_t next(void *record, uint8_t size);
+
+  /** Get previous record, towards the oldest
+   * \param[out] *record: buffer for the record
+   * \param[in] size: size of the buffer, longer records are truncated
+   * \return record length or 0 if there are no more records
+  */
+  uint8_t prev(void *record, uint8_t size);
+
+private:
+  uint32_t first, count;
+  uint32_t head;     //Sector with the newest records
+  uint32_t head_seq; //0: Log is empty
+  uint32_t tail;     //Sector with the oldest records
+  bool dirty;        //head buffer not written
+  uint16_t synced;   //Bytes of the head on disk, 0: head sector not written yet
+  uint8_t buffer[SECTOR_LEN]; //Head sector
+
+  uint32_t it_sector; //Iteration
+  uint16_t it_offset;
+  uint8_t it_buffer[SECTOR_LEN];
+
+  uint8_t read(uint32_t index, uint8_t *sect);
+  uint8_t write_head();
+  void next_slot();
+  void load(uint32_t index);
+  uint8_t copy_record(uint16_t offset, void *record, uint8_t size);
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+#include "CFPack.h"
+#include <string.h>
+
+/* Signed -> unsigned, so that small negative steps stay small */
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+  return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static uint8_t varint_len(uint32_t u)
+{
+  uint8_t n = 1;
+  while (u >= 0x80)
+  {
+    u >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t u)
+{
+  while (u >= 0x80)
+  {
+    *p++ = (u & 0x7f) | 0x80;
+    u >>= 7;
+  }
+  *p++ = u;
+  return p;
+}
+
+/* returns NULL if the varint runs past end */
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t &u)
+{
+  u = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7)
+  {
+    if (p >= end)
+      return NULL;
+    uint8_t b = *p++;
+    u |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return p;
+  }
+  return NULL;
+}
+
+static void put_u16(uint8_t *p, uint16_t u)
+{
+  p[0] = u;
+  p[1] = u >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t u)
+{
+  put_u16(p, u);
+  put_u16(p + 2, u >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+  return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static uint8_t run_len(uint32_t n, uint32_t dt, int32_t dv)
+{
+  return varint_len(n) + varint_len(dt) + varint_len(zigzag(dv));
+}
+
+void PackEncoder::begin(uint8_t *frame, uint16_t size)
+{
+  this->frame = frame;
+  this->size = size;
+  len = 0;
+  count = 0;
+  run_n = 0;
+}
+
+/* Append the pending run to the payload */
+void PackEncoder::flush_run()
+{
+  if (!run_n)
+    return;
+  uint8_t *p = frame + PACK_HEADER_LEN + len;
+  p = put_varint(p, run_n);
+  p = put_varint(p, run_dt);
+  p = put_varint(p, zigzag(run_dv));
+  len = p - frame - PACK_HEADER_LEN;
+  run_n = 0;
+}
+
+bool PackEncoder::add(uint32_t t, int32_t v)
+{
+  const uint16_t space = size - PACK_HEADER_LEN;
+  if (count == 0)
+  {
+    put_u32(frame + 6, t);
+    put_u32(frame + 10, v);
+  }
+  else
+  {
+    if (count == PACK_MAX_SAMPLES)
+      return false;
+    uint32_t dt = t - last_t;
+    int32_t dv = (int32_t)((uint32_t)v - (uint32_t)last_v);
+    if (run_n && dt == run_dt && dv == run_dv)
+    {
+      if (len + run_len(run_n + 1, dt, dv) > space)
+        return false;
+      run_n++;
+    }
+    else
+    {
+      uint8_t pending = run_n ? run_len(run_n, run_dt, run_dv) : 0;
+      if (len + pending + run_len(1, dt, dv) > space)
+        return false;
+      flush_run();
+      run_n = 1;
+      run_dt = dt;
+      run_dv = dv;
+    }
+  }
+  last_t = t;
+  last_v = v;
+  count++;
+  return true;
+}
+
+uint16_t PackEncoder::finish()
+{
+  flush_run();
+  put_u16(frame, PACK_MAGIC);
+  put_u16(frame + 2, len);
+  put_u16(frame + 4, count);
+  memset(frame + PACK_HEADER_LEN + len, 0, size - PACK_HEADER_LEN - len);
+  return PACK_HEADER_LEN + len;
+}
+
+bool PackDecoder::begin(const uint8_t *frame)
+{
+  count = remaining = 0;
+  if (get_u16(frame) != PACK_MAGIC)
+    return false;
+  uint16_t len = get_u16(frame + 2);
+  if (len > PACK_FRAME_LEN - PACK_HEADER_LEN)
+    return false;
+  p = frame + PACK_HEADER_LEN;
+  end = p + len;
+  count = remaining = get_u16(frame + 4);
+  t0 = get_u32(frame + 6);
+  v0 = get_u32(frame + 10);
+  run_n = 0;
+  return true;
+}
+
+bool PackDecoder::next(uint32_t &t, int32_t &v)
+{
+  if (!remaining)
+    return false;
+  if (remaining == count) //First sample is stored in the header
+  {
+    remaining--;
+    t = t0;
+    v = v0;
+    return true;
+  }
+  if (!run_n)
+  {
+    uint32_t dv;
+    if (!(p = get_varint(p, end, run_n)) || !(p = get_varint(p, end, run_dt)) ||
+        !(p = get_varint(p, end, dv)) || !run_n)
+    {
+      remaining = 0;
+      return false;
+    }
+    run_dv = unzigzag(dv);
+  }
+  run_n--;
+  remaining--;
+  t0 += run_dt;
+  v0 = (int32_t)((uint32_t)v0 + (uint32_t)run_dv);
+  t = t0;
+  v = v0;
+  return true;
+}
+
+#ifdef ARDUINO
+void PackLogger::begin(uint32_t sector, uint8_t mode)
+{
+  current = sector;
+  this->mode = mode;
+  encoder.begin(frame, hd_payload_len(mode));
+}
+
+uint8_t PackLogger::write()
+{
+  return mode ? hd_write_sector_crc(current, frame, mode) : hd_write_sector(current, frame);
+}
+
+uint8_t PackLogger::log(uint32_t t, int32_t v)
+{
+  if (encoder.add(t, v))
+    return 1;
+  //Frame full: write it and start a new one in the next sector
+  encoder.finish();
+  if (!write())
+    return 0;
+  current++;
+  encoder.begin(frame, hd_payload_len(mode));
+  return encoder.add(t, v);
+}
+
+uint8_t PackLogger::flush()
+{
+  if (!encoder.samples())
+    return 1;
+  encoder.finish();
+  return write();
+}
+#endif
@@ -0,0 +1,142 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+/* Packed sample logging: Timestamped integer samples are delta encoded
+and stored as runs of equal (time step, value step) pairs in sector sized frames.
+
+Frame layout (little endian):
+Offset | Size | Content
+0      | 2    | PACK_MAGIC
+2      | 2    | Payload length in bytes
+4      | 2    | Number of samples in the frame
+6      | 4    | Timestamp of the first sample
+10     | 4    | Value of the first sample (signed)
+14     | ...  | Runs: varint count, varint time step, zigzag varint value step
+Bytes after the payload are zero. Frames written with a checksum (see PackLogger::begin())
+are shorter and end with the trailer of hd_write_sector_crc(), the decoder ignores it
+
+The encoder and decoder don't depend on Arduino, so frames can be
+unpacked on a PC as well (see extras/cfunpack) */
+
+#ifndef CFPack_h
+#define CFPack_h
+#include <stdint.h>
+#include <stddef.h>
+#ifdef ARDUINO
+#include "CFCard.h"
+#endif
+
+#define PACK_MAGIC 0x4b50     //"PK"
+#define PACK_FRAME_LEN 512    //One frame per sector
+#define PACK_HEADER_LEN 14
+#define PACK_MAX_SAMPLES 0xffff
+
+class PackEncoder
+{
+public:
+  /** Start a new, empty frame
+   * \param[out] *frame: buffer of PACK_FRAME_LEN bytes
+   * \param[in] size: bytes of the frame that may be used, e.g. hd_payload_len() to leave room for a checksum
+  */
+  void begin(uint8_t *frame, uint16_t size = PACK_FRAME_LEN);
+
+  /** Add a sample to the frame
+   * \param[in] t: timestamp, must not decrease
+   * \param[in] v: value
+   * \return true: sample added, false: frame is full. Call finish() and begin() and add the sample again
+  */
+  bool add(uint32_t t, int32_t v);
+
+  /** Complete the frame. More samples can be added afterwards
+   * \return number of bytes used in the frame
+  */
+  uint16_t finish();
+
+  uint16_t samples() const { return count; }
+
+private:
+  uint8_t *frame;
+  uint16_t size;  //Usable frame bytes
+  uint16_t len;   //Payload bytes
+  uint16_t count; //Samples in the frame
+  uint32_t last_t;
+  int32_t last_v;
+  uint32_t run_n; //Pending run, not yet in the frame
+  uint32_t run_dt;
+  int32_t run_dv;
+
+  void flush_run();
+};
+
+class PackDecoder
+{
+public:
+  /** Start decoding a frame
+   * \param[in] *frame: buffer of PACK_FRAME_LEN bytes
+   * \return true: valid frame, false: no packed frame
+  */
+  bool begin(const uint8_t *frame);
+
+  /** Get next sample
+   * \return true: sample in t and v, false: no more samples or corrupt frame
+  */
+  bool next(uint32_t &t, int32_t &v);
+
+  uint16_t samples() const { return count; }
+
+private:
+  const uint8_t *p, *end;
+  uint16_t count;
+  uint16_t remaining;
+  uint32_t t0;
+  int32_t v0;
+  uint32_t run_n;
+  uint32_t run_dt;
+  int32_t run_dv;
+};
+
+#ifdef ARDUINO
+class PackLogger
+{
+public:
+  /** Start logging
+   * \param[in] sector: first sector to write
+   * \param[in] mode: CRC_NONE (default), CRC_16 or CRC_32 to write sectors with hd_write_sector_crc()
+  */
+  void begin(uint32_t sector, uint8_t mode = CRC_NONE);
+
+  /** Log a sample. Sectors are only written when a frame is full
+   * \return 1 on success, 0 on error
+  */
+  uint8_t log(uint32_t t, int32_t v);
+
+  /** Write the current, partially filled frame to disk.
+   * Following samples continue the same frame and sector
+   * \return 1 on success, 0 on error
+  */
+  uint8_t flush();
+
+  /** \return sector that is currently being filled */
+  uint32_t sector() const { return current; }
+
+private:
+  uint8_t frame[PACK_FRAME_LEN];
+  PackEncoder encoder;
+  uint32_t current;
+  uint8_t mode;
+
+  uint8_t write();
+};
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+#include "CFStream.h"
+
+void HdStream::open(uint32_t sector, uint8_t *buffer)
+{
+    pos_sector = sector;
+    pos_offset = 0;
+    this->buffer = buffer;
+    valid = dirty = false;
+}
+
+/* Get sector into buffer */
+uint8_t HdStream::load(uint32_t sector)
+{
+    if (valid && cached == sector)
+        return 1;
+    if (!flush())
+        return 0;
+    valid = false;
+    if (!hd_read_sector(sector, buffer))
+        return 0;
+    cached = sector;
+    valid = true;
+    return 1;
+}
+
+void HdStream::advance(uint16_t n)
+{
+    pos_offset += n;
+    if (pos_offset >= SECTOR_LEN)
+    {
+        pos_sector++;
+        pos_offset = 0;
+    }
+}
+
+uint16_t HdStream::read(uint8_t *dst, uint16_t len)
+{
+    uint16_t done = 0;
+    if (!buffer)
+    {
+        if (len % SECTOR_LEN)
+            return 0;
+        for (; done < len; done += SECTOR_LEN)
+        {
+            if (!hd_read_sector(pos_sector, dst + done))
+                return 0;
+            pos_sector++;
+        }
+        return len;
+    }
+    while (done < len)
+    {
+        if (!load(pos_sector))
+            return 0;
+        uint16_t n = min(len - done, SECTOR_LEN - pos_offset);
+        memcpy(dst + done, buffer + pos_offset, n);
+        done += n;
+        advance(n);
+    }
+    return done;
+}
+
+uint16_t HdStream::write(const uint8_t *src, uint16_t len)
+{
+    uint16_t done = 0;
+    if (!buffer)
+    {
+        if (len % SECTOR_LEN)
+            return 0;
+        for (; done < len; done += SECTOR_LEN)
+        {
+            if (!hd_write_sector(pos_sector, src + done))
+                return 0;
+            pos_sector++;
+        }
+        return done;
+    }
+    while (done < len)
+    {
+        if (!valid || cached != pos_sector)
+        {
+            if (pos_offset || len - done < SECTOR_LEN) //Keep the rest of the sector
+            {
+                if (!load(pos_sector))
+                    return 0;
+            }
+            else //Whole sector is overwritten, no need to read it
+            {
+                if (!flush())
+                    return 0;
+                cached = pos_sector;
+                valid = true;
+            }
+        }
+        uint16_t n = min(len - done, SECTOR_LEN - pos_offset);
+        memcpy(buffer + pos_offset, src + done, n);
+        dirty = true;
+        done += n;
+        if (pos_offset + n == SECTOR_LEN && !flush()) //Sector full
+            return 0;
+        advance(n);
+    }
+    return done;
+}
+
+uint8_t HdStream::flush()
+{
+    if (!dirty)
+        return 1;
+    if (!hd_write_sector(cached, buffer))
+        return 0;
+    dirty = false;
+    return 1;
+}
+
+uint8_t HdStream::seek(uint32_t sector, uint16_t offset)
+{
+    if (!buffer ? offset != 0 : offset >= SECTOR_LEN)
+        return 0;
+    pos_sector = sector;
+    pos_offset = offset;
+    return flush();
+}
+
+uint8_t HdStream::close()
+{
+    uint8_t ret = flush();
+    buffer = NULL;
+    valid = dirty = false; //Unwritten data is lost if flush() failed
+    return ret;
+}
+
+/* Compatibility: one stream for reading and one for writing, a new first sector restarts it */
+uint16_t hd_read_multiple(uint32_t sector, uint8_t *buffer)
+{
+    static HdStream stream;
+    static uint32_t first;
+    static bool opened = false;
+    if (!opened || sector != first)
+    {
+        stream.open(sector);
+        first = sector;
+        opened = true;
+    }
+    return stream.read(buffer, SECTOR_LEN);
+}
+
+uint8_t hd_write_multiple(uint32_t sector, const uint8_t *buffer)
+{
+    static HdStream stream;
+    static uint32_t first;
+    static bool opened = false;
+    if (!opened || sector != first)
+    {
+        stream.open(sector);
+        first = sector;
+        opened = true;
+    }
+    return stream.write(buffer, SECTOR_LEN) ? 1 : 0;
+}
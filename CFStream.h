@@ -0,0 +1,81 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+/* Sequential access to consecutive sectors. Every stream has its own position,
+so any number of streams can be used at the same time.
+Without buffer, whole sectors are transferred directly.
+With a buffer of SECTOR_LEN bytes, reads and writes can have any size: The current sector
+is kept in the buffer and written when it is full, on seek(), flush() or close().
+Streams don't share buffers, don't read sectors through one stream that another one has not flushed yet. */
+
+#ifndef CFStream_h
+#define CFStream_h
+#include "CFCard.h"
+
+class HdStream
+{
+public:
+  /** Open stream at the beginning of a sector
+   * \param[in] sector: First sector
+   * \param[in] *buffer: Optional sector buffer, SECTOR_LEN bytes
+  */
+  void open(uint32_t sector, uint8_t *buffer = NULL);
+
+  /** Read from current position
+   * \param[out] *dst: buffer with bytes read
+   * \param[in] len: number of bytes, multiple of SECTOR_LEN without buffer
+   * \return number of bytes read or 0 on error
+  */
+  uint16_t read(uint8_t *dst, uint16_t len);
+
+  /** Write at current position. With buffer, a sector that is only partially written
+   * is read first, so its other bytes are kept
+   * \param[in] *src: bytes to write
+   * \param[in] len: number of bytes, multiple of SECTOR_LEN without buffer
+   * \return number of bytes written or 0 on error
+  */
+  uint16_t write(const uint8_t *src, uint16_t len);
+
+  /** Write buffered sector and change position
+   * \param[in] sector: Sector
+   * \param[in] offset: Byte in sector, must be 0 without buffer
+   * \return 1 on success, 0 on error
+  */
+  uint8_t seek(uint32_t sector, uint16_t offset = 0);
+
+  /** Write buffered sector
+   * \return 1 on success, 0 on error
+  */
+  uint8_t flush();
+
+  /** Write buffered sector and release the buffer. The buffer is released even if writing fails
+   * \return 1 on success, 0 on error
+  */
+  uint8_t close();
+
+  uint32_t sector() const { return pos_sector; }
+  uint16_t offset() const { return pos_offset; }
+
+private:
+  uint32_t pos_sector;
+  uint16_t pos_offset;
+  uint8_t *buffer;
+  uint32_t cached; //Sector in buffer
+  bool valid;
+  bool dirty;
+
+  uint8_t load(uint32_t sector);
+  void advance(uint16_t n);
+};
+
+#endif
@@ -0,0 +1,22 @@
+// Create an MBR and a FAT32 partition, so that the disk can be used with the SdFat library
+#include "CFCard.h"
+#include "CFFormat.h"
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(100);
+  msgout("WARNING: THIS EXAMPLE ERASES ALL DATA ON YOUR DISK!");
+  if (!hd_init())
+  {
+    msgout("Error, could not find HD");
+    return;
+  }
+  msgout("Disk size: %lu sectors", hd_capacity());
+  //Uncomment, if you really want to run this
+  //if (hd_format("CFCARD"))
+  //  msgout("Disk formatted");
+}
+void loop()
+{
+}
@@ -0,0 +1,67 @@
+// Log analog values packed into sectors. Read them back on a PC with extras/cfunpack
+#include "CFCard.h"
+#include "CFPack.h"
+
+PackLogger logger;
+
+// Log n values from A0, one every 10ms, starting at sector
+bool packed_write(uint32_t sector = 2, uint16_t n = 1000)
+{
+  if (!hd_init())
+  {
+    msgout("Error, could not find HD");
+    return false;
+  }
+  logger.begin(sector);
+  for (uint16_t i = 0; i < n; i++)
+  {
+    if (!logger.log(millis(), analogRead(A0)))
+    {
+      msgout("Error writing to HD");
+      return false;
+    }
+    delay(10);
+  }
+  if (!logger.flush())
+  {
+    msgout("Error writing to HD");
+    return false;
+  }
+  msgout("%u values written to sectors %lu - %lu", n, sector, logger.sector());
+  return true;
+}
+
+// Output the values of the first frame on Serial
+bool packed_read(uint32_t sector = 2)
+{
+  uint8_t frame[PACK_FRAME_LEN];
+  PackDecoder decoder;
+  uint32_t t;
+  int32_t v;
+  if (!hd_init())
+  {
+    msgout("Error, could not find HD");
+    return false;
+  }
+  if (!hd_read_sector(sector, frame) || !decoder.begin(frame))
+  {
+    msgout("Error: no packed data in sector %lu", sector);
+    return false;
+  }
+  while (decoder.next(t, v))
+    msgout("%lu\t%ld", t, v);
+  return true;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(100);
+  msgout("WARNING: DON´T RUN THIS EXAMPLE IF THERE IS ANY IMPORTANT DATA ON YOUR DISK!");
+  //Uncomment, if you really want to run this
+  //packed_write();
+  //packed_read();
+}
+void loop()
+{
+}
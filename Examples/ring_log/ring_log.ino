@@ -0,0 +1,47 @@
+// Log analog values into a ring of sectors that survives resets
+#include "CFCard.h"
+#include "CFLog.h"
+
+#define LOG_FIRST 2     // First sector of the log
+#define LOG_SECTORS 1000
+
+HdLog hdlog;
+
+struct sample
+{
+  uint32_t time;
+  uint16_t value;
+};
+
+// Output the last n samples, newest first
+void print_last(uint8_t n)
+{
+  sample s;
+  hdlog.end();
+  while (n-- && hdlog.prev(&s, sizeof(s)))
+    msgout("%lu\t%u", s.time, s.value);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(100);
+  msgout("WARNING: DON´T RUN THIS EXAMPLE IF THERE IS ANY IMPORTANT DATA ON YOUR DISK!");
+  if (!hd_init())
+  {
+    msgout("Error, could not find HD");
+    return;
+  }
+  //Uncomment, if you really want to run this. Call format() only once
+  //hdlog.format(LOG_FIRST, LOG_SECTORS);
+  //if (hdlog.mount(LOG_FIRST, LOG_SECTORS))
+  //  print_last(10);
+}
+
+void loop()
+{
+  //sample s = {millis(), (uint16_t)analogRead(A0)};
+  //hdlog.append(&s, sizeof(s));
+  //hdlog.sync();
+  //delay(1000);
+}
@@ -0,0 +1,65 @@
+/*Arduino Library for CF Cards and PATA hard disks
+Copyright (C) 2020  Michael Linsenmeier (michalin70@gmail.com)
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.*/
+
+/* Unpack samples written with PackLogger on a PC.
+Build: g++ -O2 -I../.. -o cfunpack cfunpack.cpp ../../CFPack.cpp
+Usage: cfunpack <device or image> [first sector] [max. sectors]
+e.g.   sudo ./cfunpack /dev/sdb 2 > values.tsv
+Output is tab separated, stops at the first sector without a packed frame.
+Checksum trailers of frames logged with CRC_16 or CRC_32 are behind the payload and skipped */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "CFPack.h"
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <device or image> [first sector] [max. sectors]\n", argv[0]);
+    return 1;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  unsigned long long sector = argc > 2 ? strtoull(argv[2], NULL, 0) : 0;
+  unsigned long long max = argc > 3 ? strtoull(argv[3], NULL, 0) : ~0ULL;
+  if (fseeko(f, (off_t)sector * PACK_FRAME_LEN, SEEK_SET))
+  {
+    perror("seek");
+    return 1;
+  }
+
+  uint8_t frame[PACK_FRAME_LEN];
+  PackDecoder decoder;
+  unsigned long long frames = 0, samples = 0;
+  printf("Time\tValue\n");
+  while (frames < max && fread(frame, PACK_FRAME_LEN, 1, f) == 1 && decoder.begin(frame))
+  {
+    uint32_t t;
+    int32_t v;
+    while (decoder.next(t, v))
+    {
+      printf("%" PRIu32 "\t%" PRId32 "\n", t, v);
+      samples++;
+    }
+    frames++;
+  }
+  fprintf(stderr, "%llu samples in %llu sectors\n", samples, frames);
+  fclose(f);
+  return 0;
+}